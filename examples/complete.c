@@ -0,0 +1,124 @@
+/* This is free and unencumbered software released into the public domain. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static
+#include "../optparse.h"
+
+/* Shell completion driven by the option tables.
+ *
+ * In Bash, register the program as its own completer:
+ *
+ *   $ complete -C ./complete ./complete
+ *
+ * Bash then runs it with COMP_LINE set, the word under the cursor as
+ * the second argument, and the word before it as the third. The
+ * candidates are printed one per line and the program exits before
+ * any of its real work is set up.
+ */
+
+static const struct optparse_long global_opts[] = {
+    {"help",    'h', OPTPARSE_NONE},
+    {"verbose", 'v', OPTPARSE_NONE},
+    {"config",  'C', OPTPARSE_REQUIRED},
+    {0}
+};
+
+static const struct optparse_long build_opts[] = {
+    {"jobs",    'j', OPTPARSE_REQUIRED},
+    {"keep",    'k', OPTPARSE_NONE},
+    {"target",  't', OPTPARSE_REQUIRED},
+    {0}
+};
+
+static const struct optparse_long clean_opts[] = {
+    {"all",     'a', OPTPARSE_NONE},
+    {"dry-run", 'n', OPTPARSE_NONE},
+    {0}
+};
+
+static const struct {
+    char name[8];
+    const struct optparse_long *longopts;
+} cmds[] = {
+    {"build", build_opts},
+    {"clean", clean_opts},
+};
+static const int ncmds = sizeof(cmds) / sizeof(*cmds);
+
+/* Find the subcommand named before the word being completed, if any. */
+static const struct optparse_long *
+subcommand(const char *line, size_t len)
+{
+    char buf[256];
+    char *p, *prev = 0;
+    int i;
+
+    len = len < sizeof(buf) ? len : sizeof(buf) - 1;
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    strtok(buf, " "); /* skip the program name */
+    while ((p = strtok(0, " "))) {
+        int takes_arg = prev && optparse_complete_arg(global_opts, prev) >= 0;
+        if (p[0] != '-' && !takes_arg)
+            for (i = 0; i < ncmds; i++)
+                if (!strcmp(cmds[i].name, p))
+                    return cmds[i].longopts;
+        prev = p;
+    }
+    return 0;
+}
+
+static int
+complete(const char *line, size_t point, const char *word, const char *prev)
+{
+    int i;
+    const struct optparse_long *longopts;
+
+    point = point < strlen(line) ? point : strlen(line);
+    point = point > strlen(word) ? point - strlen(word) : 0;
+    longopts = subcommand(line, point);
+
+    if (!longopts)
+        longopts = global_opts;
+    if (optparse_complete_arg(longopts, prev) >= 0)
+        return 0; /* an option value: let the shell fall back */
+
+    if (word[0] == '-') {
+        for (i = 0; (i = optparse_complete(longopts, word, i)) >= 0; i++)
+            printf("--%.*s\n", (int)strcspn(longopts[i].longname, "|"),
+                   longopts[i].longname);
+    } else if (longopts == global_opts) {
+        for (i = 0; i < ncmds; i++)
+            if (!strncmp(cmds[i].name, word, strlen(word)))
+                printf("%s\n", cmds[i].name);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int option;
+    char *line = getenv("COMP_LINE");
+    char *point = getenv("COMP_POINT");
+    struct optparse options;
+
+    if (line && point && argc == 4)
+        return complete(line, strtoul(point, 0, 10), argv[2], argv[3]);
+
+    optparse_init(&options, argv);
+    options.permute = 0;
+    while ((option = optparse_long(&options, global_opts, NULL)) != -1) {
+        switch (option) {
+        case 'h':
+            puts("usage: complete [-hv] [-C FILE] <build|clean> [OPTION]...");
+            return 0;
+        case '?':
+            fprintf(stderr, "%s: %s\n", argv[0], options.errmsg);
+            return 1;
+        }
+    }
+    return 0;
+}
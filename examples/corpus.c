@@ -0,0 +1,351 @@
+/* This is free and unencumbered software released into the public domain. */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static
+#include "../optparse.h"
+
+/* Parse a corpus of recorded command lines on all cores.
+ *
+ * Each record holds the arguments of one invocation, each terminated by
+ * a NUL byte, followed by a newline that may be left off the last record.
+ * Arguments may contain newlines but not begin with one. The file is
+ * mapped read-only and parsed in place. Every record is parsed against the
+ * option spec given with -s and one row is written per option found, as
+ * four column files:
+ *
+ *   PREFIX.opt  int32  option returned by optparse_long()
+ *   PREFIX.idx  int32  longindex
+ *   PREFIX.off  int64  file offset of the option's value, or -1
+ *   PREFIX.rec  int64  record number
+ *
+ * A record with an argument missing its NUL is counted as an error.
+ * Per-option totals are printed to standard output and throughput to
+ * standard error. Chunks of the file are handed out to worker threads
+ * from a shared counter, so faster threads simply take more chunks.
+ */
+
+#define MAXOPTS   256
+#define CHUNKSIZE (1L << 20)
+
+struct column {
+    char *data;
+    size_t len, cap;
+};
+
+struct chunk {
+    char *beg, *end;
+    long nrecords;
+    struct column opt, idx, off, rec;
+};
+
+static struct {
+    struct optparse_long longopts[MAXOPTS + 1];
+    int nlongopts;
+    char *map;
+    struct chunk *chunks;
+    long nchunks;
+    long next;             /* next chunk to be claimed */
+    pthread_mutex_t lock;
+} corpus;
+
+struct worker {
+    pthread_t thread;
+    unsigned long counts[MAXOPTS];
+    unsigned long errors;
+};
+
+static void
+usage(FILE *f)
+{
+    fprintf(f, "usage: corpus [-h] [-j THREADS] [-o PREFIX] -s SPEC FILE\n");
+    fprintf(f, "  SPEC is a comma-separated list of LONG[/SHORT][:[:]], "
+               "e.g. amend/a,color/c:,delay::\n");
+}
+
+/* Build the option table from the spec, returning 0 on error. */
+static int
+parse_spec(char *spec)
+{
+    char *p;
+    for (p = strtok(spec, ","); p; p = strtok(0, ",")) {
+        struct optparse_long *o = corpus.longopts + corpus.nlongopts;
+        char *colon = strchr(p, ':');
+        char *slash = strchr(p, '/');
+        if (corpus.nlongopts == MAXOPTS)
+            return 0;
+        o->argtype = OPTPARSE_NONE;
+        if (colon) {
+            o->argtype = colon[1] == ':' ? OPTPARSE_OPTIONAL
+                                         : OPTPARSE_REQUIRED;
+            *colon = '\0';
+        }
+        o->shortname = 0x110000 + corpus.nlongopts;
+        if (slash) {
+            *slash = '\0';
+            o->shortname = (unsigned char)slash[1];
+        }
+        o->longname = p;
+        corpus.nlongopts++;
+    }
+    return corpus.nlongopts > 0;
+}
+
+static void
+append(struct column *c, const void *data, size_t len)
+{
+    if (c->len + len > c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 4096;
+        if (!(c->data = realloc(c->data, c->cap))) {
+            fprintf(stderr, "corpus: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(c->data + c->len, data, len);
+    c->len += len;
+}
+
+static void
+parse_chunk(struct worker *w, struct chunk *c, char ***argv, size_t *cap)
+{
+    char *p = c->beg;
+    while (p < c->end) {
+        int option, longindex;
+        size_t argc = 0;
+        struct optparse options;
+        int64_t record = c->nrecords++;
+
+        /* Point a NULL-terminated argv at the arguments in the map. */
+        for (; p < c->end && *p != '\n'; argc++) {
+            char *nul = memchr(p, '\0', c->end - p);
+            if (!nul)
+                break;
+            if (argc + 2 > *cap) {
+                *cap = *cap ? *cap * 2 : 64;
+                *argv = realloc(*argv, *cap * sizeof(**argv));
+                if (!*argv) {
+                    fprintf(stderr, "corpus: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            (*argv)[argc] = p;
+            p = nul + 1;
+        }
+        if (p < c->end && *p != '\n') {
+            w->errors++; /* unterminated argument at end of file */
+            break;
+        }
+        p++; /* skip the newline, if any */
+        if (!argc)
+            continue;
+        (*argv)[argc] = 0;
+
+        optparse_init(&options, *argv);
+        while ((option = optparse_long(&options, corpus.longopts,
+                                       &longindex)) != -1) {
+            int32_t opt = option, idx = longindex;
+            int64_t off = -1;
+            if (option == '?') {
+                w->errors++;
+                continue;
+            }
+            if (options.optarg)
+                off = options.optarg - corpus.map;
+            w->counts[longindex]++;
+            append(&c->opt, &opt, sizeof(opt));
+            append(&c->idx, &idx, sizeof(idx));
+            append(&c->off, &off, sizeof(off));
+            append(&c->rec, &record, sizeof(record));
+        }
+    }
+}
+
+static void *
+work(void *arg)
+{
+    struct worker *w = arg;
+    char **argv = 0;
+    size_t cap = 0;
+    for (;;) {
+        long i;
+        pthread_mutex_lock(&corpus.lock);
+        i = corpus.next++;
+        pthread_mutex_unlock(&corpus.lock);
+        if (i >= corpus.nchunks)
+            break;
+        parse_chunk(w, corpus.chunks + i, &argv, &cap);
+    }
+    free(argv);
+    return 0;
+}
+
+/* Split the file into chunks that begin and end on record boundaries. */
+static void
+split(size_t size)
+{
+    char *p = corpus.map, *end = corpus.map + size;
+    corpus.nchunks = 0;
+    corpus.chunks = calloc(size / CHUNKSIZE + 1, sizeof(*corpus.chunks));
+    if (!corpus.chunks) {
+        fprintf(stderr, "corpus: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    while (p < end) {
+        struct chunk *c = corpus.chunks + corpus.nchunks++;
+        c->beg = p;
+        p = end - p > CHUNKSIZE ? p + CHUNKSIZE : end;
+        /* A record ends at a newline following a NUL. */
+        while (p < end && !(p[0] == '\n' && p[-1] == '\0'))
+            p++;
+        c->end = p < end ? p + 1 : end;
+        p = c->end;
+    }
+}
+
+static int
+write_column(const char *prefix, const char *suffix, size_t offset)
+{
+    long i;
+    char path[4096];
+    FILE *f;
+
+    sprintf(path, "%.4000s.%s", prefix, suffix);
+    if (!(f = fopen(path, "wb"))) {
+        fprintf(stderr, "corpus: could not open %s\n", path);
+        return 0;
+    }
+    for (i = 0; i < corpus.nchunks; i++) {
+        struct column *c = (struct column *)((char *)(corpus.chunks + i) +
+                                             offset);
+        fwrite(c->data, 1, c->len, f);
+    }
+    fflush(f);
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "corpus: error writing %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int i, option, fd;
+    long j, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    long nrecords = 0;
+    unsigned long errors = 0;
+    char *spec = 0, *prefix = "corpus";
+    struct timespec start, stop;
+    struct worker *workers;
+    struct stat st;
+    struct optparse options;
+    double elapsed;
+
+    (void)argc;
+    optparse_init(&options, argv);
+    while ((option = optparse(&options, "hj:o:s:")) != -1) {
+        switch (option) {
+        case 'h':
+            usage(stdout);
+            return 0;
+        case 'j':
+            nthreads = atol(options.optarg);
+            break;
+        case 'o':
+            prefix = options.optarg;
+            break;
+        case 's':
+            spec = options.optarg;
+            break;
+        case '?':
+            usage(stderr);
+            fprintf(stderr, "%s: %s\n", argv[0], options.errmsg);
+            return 1;
+        }
+    }
+    if (!spec || !parse_spec(spec) || !argv[options.optind]) {
+        usage(stderr);
+        return 1;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+
+    fd = open(argv[options.optind], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: could not open %s\n", argv[0],
+                argv[options.optind]);
+        return 1;
+    }
+    if (st.st_size) {
+        corpus.map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (corpus.map == MAP_FAILED) {
+            fprintf(stderr, "%s: could not map %s\n", argv[0],
+                    argv[options.optind]);
+            return 1;
+        }
+    }
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    split(st.st_size);
+    pthread_mutex_init(&corpus.lock, 0);
+    workers = calloc(nthreads, sizeof(*workers));
+    if (!workers) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    for (j = 0; j < nthreads; j++) {
+        if (pthread_create(&workers[j].thread, 0, work, workers + j)) {
+            fprintf(stderr, "%s: could not start threads\n", argv[0]);
+            return 1;
+        }
+    }
+    for (j = 0; j < nthreads; j++)
+        pthread_join(workers[j].thread, 0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    /* Turn chunk-relative record numbers into file-wide ones. */
+    for (j = 0; j < corpus.nchunks; j++) {
+        struct chunk *c = corpus.chunks + j;
+        int64_t *rec = (int64_t *)c->rec.data;
+        size_t k, n = c->rec.len / sizeof(*rec);
+        for (k = 0; k < n; k++)
+            rec[k] += nrecords;
+        nrecords += c->nrecords;
+    }
+
+    if (!write_column(prefix, "opt", offsetof(struct chunk, opt)) ||
+        !write_column(prefix, "idx", offsetof(struct chunk, idx)) ||
+        !write_column(prefix, "off", offsetof(struct chunk, off)) ||
+        !write_column(prefix, "rec", offsetof(struct chunk, rec)))
+        return 1;
+
+    for (i = 0; i < corpus.nlongopts; i++) {
+        unsigned long count = 0;
+        for (j = 0; j < nthreads; j++)
+            count += workers[j].counts[i];
+        printf("%-24s %lu\n", corpus.longopts[i].longname, count);
+    }
+    for (j = 0; j < nthreads; j++)
+        errors += workers[j].errors;
+    printf("%-24s %lu\n", "(errors)", errors);
+    printf("%-24s %ld\n", "(records)", nrecords);
+
+    elapsed = (stop.tv_sec - start.tv_sec) +
+              (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld records, %ld bytes, %ld threads in %.3f s: "
+            "%.0f records/s, %.1f MB/s\n",
+            nrecords, (long)st.st_size, nthreads, elapsed,
+            nrecords / elapsed, st.st_size / elapsed / 1e6);
+    return 0;
+}
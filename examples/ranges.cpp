@@ -0,0 +1,49 @@
+/* This is free and unencumbered software released into the public domain. */
+#include <cstdio>
+#include <cstdlib>
+
+#include "../optparse.hpp"
+
+int main(int, char **argv)
+{
+    static constexpr optparse::spec longopts[] = {
+        {"amend", 'a', optparse::none},
+        {"brief", 'b', optparse::none},
+        {"color", 'c', optparse::required},
+        {"delay", 'd', optparse::optional},
+        {},
+    };
+
+    bool amend = false;
+    bool brief = false;
+    const char *color = "white";
+    int delay = 0;
+
+    auto parser = optparse::options(argv, longopts);
+    for (auto [opt, arg, index] : parser) {
+        switch (opt) {
+        case 'a':
+            amend = true;
+            break;
+        case 'b':
+            brief = true;
+            break;
+        case 'c':
+            color = arg;
+            break;
+        case 'd':
+            delay = arg ? std::atoi(arg) : 1;
+            break;
+        case '?':
+            std::fprintf(stderr, "%s: %s\n", argv[0], parser.errmsg());
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Print remaining arguments. */
+    for (char *arg : parser.args())
+        std::printf("%s\n", arg);
+
+    (void)amend, (void)brief, (void)color, (void)delay;
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* This is free and unencumbered software released into the public domain. */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Parse statistics collected through the OPTPARSE_TRACE hook.
+ *
+ * Without the hook the parser compiles exactly as usual. With it, every
+ * option is counted by its longopts index, along with errors by error
+ * code and permutation moves, and the time from optparse_init() to the end of
+ * parsing is measured with the monotonic clock. The record is printed
+ * as text, or with -B written in binary for aggregation: little-endian
+ * 32-bit counts of options and permutation moves, the elapsed nanoseconds
+ * as 64 bits, the number of longopts entries and the count for each, and
+ * then the number of error codes and the count for each.
+ */
+
+#define NLONGOPTS 4
+
+static void trace(int event, int value);
+
+#define OPTPARSE_TRACE(options, event, value) trace(event, value)
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static
+#include "../optparse.h"
+
+#define NERRORS (OPTPARSE_EDEPTH + 1)
+
+static struct {
+    unsigned long options;
+    unsigned long longindex[NLONGOPTS];
+    unsigned long errors[NERRORS]; /* by enum optparse_errcode */
+    unsigned long permutes;       /* elements shifted by permutation */
+    struct timespec start;
+    unsigned long nanoseconds;
+} stats;
+
+static void
+trace(int event, int value)
+{
+    struct timespec now;
+    switch (event) {
+    case OPTPARSE_EVENT_INIT:
+        clock_gettime(CLOCK_MONOTONIC, &stats.start);
+        break;
+    case OPTPARSE_EVENT_OPTION:
+        stats.options++;
+        break;
+    case OPTPARSE_EVENT_LONGINDEX:
+        if (value >= 0 && value < NLONGOPTS)
+            stats.longindex[value]++;
+        break;
+    case OPTPARSE_EVENT_ERROR:
+        if (value >= 0 && value < NERRORS)
+            stats.errors[value]++;
+        break;
+    case OPTPARSE_EVENT_PERMUTE:
+        stats.permutes += value;
+        break;
+    case OPTPARSE_EVENT_DONE:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        stats.nanoseconds = (now.tv_sec - stats.start.tv_sec) * 1000000000L +
+                            (now.tv_nsec - stats.start.tv_nsec);
+        break;
+    }
+}
+
+static const char *const error_names[NERRORS] = {
+    "none", "invalid", "missing", "toomany",
+    "requires", "conflicts", "anyof", "depth"
+};
+
+static void
+print_stats(const struct optparse_long *longopts)
+{
+    int i;
+    printf("options %lu\n", stats.options);
+    for (i = 0; i < NLONGOPTS; i++)
+        if (stats.longindex[i])
+            printf("option %s %lu\n", longopts[i].longname,
+                   stats.longindex[i]);
+    for (i = 0; i < NERRORS; i++)
+        if (stats.errors[i])
+            printf("error %s %lu\n", error_names[i], stats.errors[i]);
+    printf("permutes %lu\n", stats.permutes);
+    printf("nanoseconds %lu\n", stats.nanoseconds);
+}
+
+static void
+write32(unsigned long x)
+{
+    unsigned char buf[4];
+    buf[0] = (unsigned char)(x >>  0);
+    buf[1] = (unsigned char)(x >>  8);
+    buf[2] = (unsigned char)(x >> 16);
+    buf[3] = (unsigned char)(x >> 24);
+    fwrite(buf, sizeof(buf), 1, stdout);
+}
+
+static void
+write_stats(void)
+{
+    int i;
+    write32(stats.options);
+    write32(stats.permutes);
+    write32(stats.nanoseconds & 0xffffffffUL);
+    write32(stats.nanoseconds >> 16 >> 16);
+    write32(NLONGOPTS);
+    for (i = 0; i < NLONGOPTS; i++)
+        write32(stats.longindex[i]);
+    write32(NERRORS);
+    for (i = 0; i < NERRORS; i++)
+        write32(stats.errors[i]);
+}
+
+int main(int argc, char **argv)
+{
+    struct optparse_long longopts[NLONGOPTS + 1] = {
+        {"amend",  'a', OPTPARSE_NONE},
+        {"binary", 'B', OPTPARSE_NONE},
+        {"color",  'c', OPTPARSE_REQUIRED},
+        {"delay",  'd', OPTPARSE_OPTIONAL},
+        {0}
+    };
+
+    int binary = 0;
+    int option;
+    struct optparse options;
+
+    (void)argc;
+    optparse_init(&options, argv);
+    while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+        switch (option) {
+        case 'B':
+            binary = 1;
+            break;
+        case '?':
+            fprintf(stderr, "%s: %s\n", argv[0], options.errmsg);
+            break;
+        }
+    }
+
+    if (binary) {
+        write_stats();
+        return !!ferror(stdout);
+    }
+    print_stats(longopts);
+    return 0;
+}
@@ -6,6 +6,17 @@
  * Optionally define OPTPARSE_API to control the API's visibility
  * and/or linkage (static, __attribute__, __declspec).
  *
+ * Optionally define any of these to leave out features, for a smaller
+ * parser in programs that do not need them:
+ *
+ *   OPTPARSE_NO_LONG     long options and everything using longopts
+ *   OPTPARSE_NO_PERMUTE  argv permutation; parsing stops at a non-option
+ *   OPTPARSE_NO_ERRMSG   error messages; errmsg is always empty
+ *
+ * Optionally define OPTPARSE_TRACE(options, event, value) before the
+ * implementation to observe parsing, such as for usage statistics. See
+ * enum optparse_event. By default it expands to nothing.
+ *
  * The POSIX getopt() option parser has three fatal flaws. These flaws
  * are solved by Optparse.
  *
@@ -51,6 +62,17 @@
 #  define OPTPARSE_API
 #endif
 
+enum optparse_errcode {
+    OPTPARSE_ENONE,
+    OPTPARSE_EINVALID,
+    OPTPARSE_EMISSING,
+    OPTPARSE_ETOOMANY,
+    OPTPARSE_EREQUIRES,     /* constraint errors from optparse_check() */
+    OPTPARSE_ECONFLICTS,
+    OPTPARSE_EANYOF,
+    OPTPARSE_EDEPTH         /* too many results for optparse_cached() */
+};
+
 struct optparse {
     char **argv;
     int permute;
@@ -58,13 +80,44 @@ struct optparse {
     int optopt;
     char *optarg;
     char errmsg[64];
+    enum optparse_errcode error;
+    int subopt;
+    struct optparse_undo *undo;
+    const struct optparse_shorts *shorts;
+};
+
+/* Log of argv permutations, so that they can be undone. The caller
+ * supplies the storage: two ints per permutation, size permutations.
+ * Each parser call may permute every pending non-option argument once.
+ */
+struct optparse_undo {
+    int *log;
+    int size;
+    int len;
+};
+
+/* Compact form of the parser state, for keeping many parses suspended.
+ * Instead of a message it holds an error code (enum optparse_errcode).
+ */
+struct optparse_state {
+    char **argv;
+    int optind;
     int subopt;
+    unsigned char permute;
+    unsigned char error;
+};
+
+/* Parser state to return to with optparse_restore(). */
+struct optparse_snapshot {
+    struct optparse_state state;
+    int undolen;
 };
 
 enum optparse_argtype {
     OPTPARSE_NONE,
     OPTPARSE_REQUIRED,
-    OPTPARSE_OPTIONAL
+    OPTPARSE_OPTIONAL,
+    OPTPARSE_NEGATABLE
 };
 
 struct optparse_long {
@@ -73,6 +126,81 @@ struct optparse_long {
     enum optparse_argtype argtype;
 };
 
+/* Short option lookup for optparse_long(), in caller-supplied storage:
+ * nslots ints hashing the shortnames outside ASCII.
+ */
+struct optparse_shorts {
+    const struct optparse_long *longopts;
+    int ascii[128];     /* longindex for each ASCII shortname, or -1 */
+    int *slots;         /* longindex, or -1 for an empty slot */
+    int nslots;
+    int utf8;           /* decode short options as UTF-8 */
+};
+
+enum optparse_ruletype {
+    OPTPARSE_REQUIRES,  /* if a is given, b must also be given */
+    OPTPARSE_CONFLICTS, /* a and b cannot both be given */
+    OPTPARSE_ANYOF      /* a or b must be given, or just a if a == b */
+};
+
+struct optparse_rule {
+    enum optparse_ruletype type;
+    int a;
+    int b;
+};
+
+/* One parse result, referring to argv by index so that it applies to
+ * any argv with the same contents. A non-option argument has option 0
+ * and longindex -1.
+ */
+struct optparse_item {
+    int option;
+    int longindex;
+    int argind;     /* argv index of optarg or the argument, or -1 */
+    int argoff;     /* offset of optarg within argv[argind] */
+};
+
+struct optparse_memo {
+    unsigned long hash;
+    unsigned long length;
+    const struct optparse_long *longopts;
+    int count;
+};
+
+/* Cache of parse results in caller-supplied storage: nslots memos,
+ * initially all zeros, and depth items for each of them.
+ */
+struct optparse_cache {
+    struct optparse_memo *memos;
+    struct optparse_item *items;
+    int nslots;
+    int depth;
+};
+
+/* Where each option in longopts was given, built on the first lookup.
+ * The caller supplies one count and one value per longopts entry, and
+ * nslots ints hashing the long names.
+ */
+struct optparse_index {
+    char **argv;
+    const struct optparse_long *longopts;
+    int *counts;
+    char **values;
+    int *slots;     /* longindex, or -1 for an empty slot */
+    int nslots;
+    int built;
+};
+
+/* Events reported to OPTPARSE_TRACE, along with an int value. */
+enum optparse_event {
+    OPTPARSE_EVENT_INIT,      /* parser initialized, value is 0 */
+    OPTPARSE_EVENT_OPTION,    /* value is the option returned */
+    OPTPARSE_EVENT_LONGINDEX, /* value is the matched longopts index */
+    OPTPARSE_EVENT_ERROR,     /* value is the enum optparse_errcode */
+    OPTPARSE_EVENT_PERMUTE,   /* value is the number of elements shifted */
+    OPTPARSE_EVENT_DONE       /* -1 is being returned, value is optind */
+};
+
 /**
  * Initializes the parser state.
  */
@@ -91,16 +219,27 @@ void optparse_init(struct optparse *options, char **argv);
 OPTPARSE_API
 int optparse(struct optparse *options, const char *optstring);
 
+#ifndef OPTPARSE_NO_LONG
 /**
  * Handles GNU-style long options in addition to getopt() options.
  * This works a lot like GNU's getopt_long(). The last option in
  * longopts must be all zeros, marking the end of the array. The
  * longindex argument may be NULL.
+ *
+ * A longname may list aliases separated by "|", such as "color|colour".
+ * An OPTPARSE_NEGATABLE option takes no argument but may also be given
+ * as "--no-" followed by its name, in which case optarg is set to the
+ * option text after the "--". Otherwise its optarg is NULL.
+ *
+ * As with optparse(), only ASCII shortnames can be given as short
+ * options, so options with no short form may use any code from 127 up,
+ * such as 256. See optparse_shorts_init() for non-ASCII short options.
  */
 OPTPARSE_API
 int optparse_long(struct optparse *options,
                   const struct optparse_long *longopts,
                   int *longindex);
+#endif /* OPTPARSE_NO_LONG */
 
 /**
  * Used for stepping over non-option arguments.
@@ -114,29 +253,275 @@ int optparse_long(struct optparse *options,
 OPTPARSE_API
 char *optparse_arg(struct optparse *options);
 
+/**
+ * Stores the parser state in its compact form.
+ *
+ * Parsing can be resumed later with optparse_load(), so only the compact
+ * state needs to be kept between calls. The error message is reduced to
+ * the error code in the error field, which every function that sets
+ * errmsg also sets.
+ */
+OPTPARSE_API
+void optparse_save(const struct optparse *options,
+                   struct optparse_state *state);
+
+/**
+ * Restores the parser state from its compact form.
+ *
+ * The optarg and optopt fields are cleared. If an error was saved, the
+ * errmsg field is rendered again, though without the offending option.
+ *
+ * The undo and shorts fields are not part of the compact state, so the
+ * parser need not be initialized before loading. They are cleared, and
+ * must be attached again after every load, or UTF-8 short options and
+ * undo logging stop.
+ */
+OPTPARSE_API
+void optparse_load(struct optparse *options,
+                   const struct optparse_state *state);
+
+/**
+ * Records the parser state for a later optparse_restore().
+ *
+ * To also restore the order of argv, attach an undo log to the undo
+ * field before parsing. Each permutation is then recorded in the log,
+ * and restoring undoes only those made since the snapshot, rather than
+ * requiring a copy of all of argv.
+ */
+OPTPARSE_API
+void optparse_snapshot(const struct optparse *options,
+                       struct optparse_snapshot *snapshot);
+
+/**
+ * Returns the parser, and argv, to the state of an earlier snapshot.
+ * @return 1 on success, or 0 if the undo log ran out of room or the
+ *         snapshot is later than the current state
+ *
+ * Only snapshots taken before the current state can be restored, since
+ * the log only records how to undo permutations, not how to redo them.
+ * Once restored to a snapshot, any later one is no longer valid.
+ *
+ * On failure the parser is unchanged, and argv must be restored some
+ * other way. Without an undo log argv is left as it is.
+ */
+OPTPARSE_API
+int optparse_restore(struct optparse *options,
+                     const struct optparse_snapshot *snapshot);
+
+#ifndef OPTPARSE_NO_LONG
+/**
+ * Builds a constant-time short option lookup for optparse_long().
+ * @param slots storage for nslots ints
+ * @param nslots more than the number of shortnames outside ASCII
+ * @return 1 on success, or 0 if nslots is too small
+ *
+ * Attach the table to the shorts field of a parser after optparse_init().
+ * Without one, each short option is found by scanning longopts. A table
+ * built for another longopts is ignored.
+ *
+ * Set the utf8 field to 1 to also decode short options as UTF-8, so that
+ * a shortname may be any Unicode code point. Options with no short form
+ * must then use a shortname above 0x10ffff, such as 0x110000 + n. Bytes
+ * that are not valid UTF-8 are reported as invalid options.
+ */
+OPTPARSE_API
+int optparse_shorts_init(struct optparse_shorts *shorts,
+                         const struct optparse_long *longopts,
+                         int *slots,
+                         int nslots);
+
+/**
+ * Finds long options matching a partially-typed word, for completion.
+ * @param word the word being completed, such as "--co" or "-"
+ * @param index where to continue searching, 0 for the first match
+ * @return the index of the next matching option in longopts, or -1
+ *
+ * Pass the previous return value plus one to continue the search.
+ * Only words starting with "--", or a lone "-", produce candidates, and
+ * only the first of an option's aliases is matched.
+ * No parser state is needed, so a program can answer a completion
+ * request before doing any of its own initialization.
+ */
+OPTPARSE_API
+int optparse_complete(const struct optparse_long *longopts,
+                      const char *word,
+                      int index);
+
+/**
+ * Determines if the word following the given word is an option argument.
+ * @param word a complete word from the command line
+ * @return the index of the option requiring an argument, or -1
+ *
+ * During completion, pass the word before the cursor. When this returns
+ * an index, the word under the cursor is a value for that option rather
+ * than another option.
+ */
+OPTPARSE_API
+int optparse_complete_arg(const struct optparse_long *longopts,
+                          const char *word);
+
+/**
+ * Parses argv like optparse_long(), reusing results for repeated argv.
+ * @param options initialized with optparse_init() on the argv to parse
+ * @param items set to the results, in argv order
+ * @return the number of results, or -1 on error
+ *
+ * The cache is keyed by a hash of optind and subopt, the argv contents
+ * from optind on, and the longopts table, so a repeated command line
+ * costs only the hash. On a hit the parser is left at the end of argv,
+ * as after a miss. Each hash maps to one slot, evicting whatever was
+ * there before.
+ * A hash collision between two distinct argv of the same total length
+ * would return the results of the other, which is very unlikely but not
+ * impossible.
+ *
+ * Parsing is as with optparse_long(), honoring the permute field, but
+ * argv is never permuted. Non-option arguments are included in the
+ * results instead. On error, or if the results exceed the cache depth,
+ * nothing is cached and errmsg is set.
+ */
+OPTPARSE_API
+int optparse_cached(struct optparse *options,
+                    const struct optparse_long *longopts,
+                    struct optparse_cache *cache,
+                    const struct optparse_item **items);
+
+/**
+ * Initializes an index for looking up individual options in argv.
+ * @param counts storage for one int per longopts entry
+ * @param values storage for one pointer per longopts entry
+ * @param slots storage for nslots ints
+ * @param nslots more than the number of long names, counting aliases
+ * @return 1 on success, or 0 if nslots is too small
+ *
+ * The long names are hashed here. Nothing is parsed until the first
+ * optparse_lookup().
+ */
+OPTPARSE_API
+int optparse_index_init(struct optparse_index *index,
+                        char **argv,
+                        const struct optparse_long *longopts,
+                        int *counts,
+                        char **values,
+                        int *slots,
+                        int nslots);
+
+/**
+ * Looks up a single long option in argv without a full option loop.
+ * @param name a long option name, or one of its aliases
+ * @param optarg if not NULL, set to the option's last optarg
+ * @return the number of times the option was given, or -1 on error
+ *
+ * The first lookup parses all of argv once, without permuting it, and
+ * records every option, so later lookups do not touch argv. Options are
+ * found exactly as optparse_long() would find them: arguments after
+ * "--" and required arguments are never taken as options. An argv that
+ * fails to parse returns -1 for every lookup.
+ *
+ * Names are found through the hash built by optparse_index_init(), so
+ * a lookup costs a hash of the name. As with optparse_long(), "no-"
+ * followed by the name of an OPTPARSE_NEGATABLE option finds that
+ * option, whose optarg tells whether it was last given negated. After
+ * the first lookup the counts and values arrays may also be read
+ * directly by longindex.
+ */
+OPTPARSE_API
+int optparse_lookup(struct optparse_index *index,
+                    const char *name,
+                    char **optarg);
+
+/**
+ * Checks constraints between options after parsing with optparse_long().
+ * @param seen a bitset of the given options, bit i for longopts[i]
+ * @param rules constraints between longopts indexes, ending in all zeros
+ * @return the index of the first violated rule, or -1 if none
+ *
+ * While parsing, record each option in the bitset with:
+ *
+ *   seen[longindex / 8] |= 1 << longindex % 8;
+ *
+ * For a violated rule the errmsg field describes the problem, with
+ * optopt set to the shortname of the rule's first option.
+ */
+OPTPARSE_API
+int optparse_check(struct optparse *options,
+                   const struct optparse_long *longopts,
+                   const struct optparse_rule *rules,
+                   const unsigned char *seen);
+#endif /* OPTPARSE_NO_LONG */
+
 /* Implementation */
 #ifdef OPTPARSE_IMPLEMENTATION
 
+#ifndef OPTPARSE_TRACE
+#  define OPTPARSE_TRACE(options, event, value)
+#endif
+
 #define OPTPARSE_MSG_INVALID "invalid option"
 #define OPTPARSE_MSG_MISSING "option requires an argument"
 #define OPTPARSE_MSG_TOOMANY "option takes no arguments"
+#define OPTPARSE_MSG_REQUIRES "option requires '"
+#define OPTPARSE_MSG_CONFLICTS "option conflicts with '"
+#define OPTPARSE_MSG_ANYOF "option required"
+#define OPTPARSE_MSG_ONEOF "one of these options is required"
+#define OPTPARSE_MSG_DEPTH "too many arguments to cache"
 
 static int
-optparse_error(struct optparse *options, const char *msg, const char *data)
+optparse_error(struct optparse *options,
+               enum optparse_errcode error,
+               const char *msg,
+               const char *data)
 {
+#ifndef OPTPARSE_NO_ERRMSG
     unsigned p = 0;
     const char *sep = " -- '";
-    while (*msg)
+    while (p < sizeof(options->errmsg) - 2 && *msg)
         options->errmsg[p++] = *msg++;
-    while (*sep)
+    while (p < sizeof(options->errmsg) - 2 && *sep)
         options->errmsg[p++] = *sep++;
     while (p < sizeof(options->errmsg) - 2 && *data)
         options->errmsg[p++] = *data++;
     options->errmsg[p++] = '\'';
     options->errmsg[p++] = '\0';
+#else
+    (void)msg;
+    (void)data;
+#endif
+    options->error = error;
+    OPTPARSE_TRACE(options, OPTPARSE_EVENT_ERROR, error);
     return '?';
 }
 
+#ifndef OPTPARSE_NO_ERRMSG
+/* Messages by error code, with no option attached. */
+static const char *const optparse_messages[] = {
+    "",
+    OPTPARSE_MSG_INVALID,
+    OPTPARSE_MSG_MISSING,
+    OPTPARSE_MSG_TOOMANY,
+    "option requires another option",
+    "option conflicts with another option",
+    OPTPARSE_MSG_ANYOF,
+    OPTPARSE_MSG_DEPTH
+};
+#endif
+
+/* Set the error code, and errmsg to its message. */
+static void
+optparse_message(struct optparse *options, enum optparse_errcode error)
+{
+#ifndef OPTPARSE_NO_ERRMSG
+    unsigned p = 0;
+    const char *msg = optparse_messages[error];
+    while (p < sizeof(options->errmsg) - 1 && *msg)
+        options->errmsg[p++] = *msg++;
+    options->errmsg[p] = '\0';
+#else
+    options->errmsg[0] = '\0';
+#endif
+    options->error = error;
+}
+
 OPTPARSE_API
 void
 optparse_init(struct optparse *options, char **argv)
@@ -147,6 +532,10 @@ optparse_init(struct optparse *options, char **argv)
     options->subopt = 0;
     options->optarg = 0;
     options->errmsg[0] = '\0';
+    options->error = OPTPARSE_ENONE;
+    options->undo = 0;
+    options->shorts = 0;
+    OPTPARSE_TRACE(options, OPTPARSE_EVENT_INIT, 0);
 }
 
 static int
@@ -161,12 +550,15 @@ optparse_is_shortopt(const char *arg)
     return arg != 0 && arg[0] == '-' && arg[1] != '-' && arg[1] != '\0';
 }
 
+#ifndef OPTPARSE_NO_LONG
 static int
 optparse_is_longopt(const char *arg)
 {
     return arg != 0 && arg[0] == '-' && arg[1] == '-' && arg[2] != '\0';
 }
+#endif
 
+#ifndef OPTPARSE_NO_PERMUTE
 static void
 optparse_permute(struct optparse *options, int index)
 {
@@ -175,7 +567,18 @@ optparse_permute(struct optparse *options, int index)
     for (i = index; i < options->optind - 1; i++)
         options->argv[i] = options->argv[i + 1];
     options->argv[options->optind - 1] = nonoption;
+    if (options->undo) {
+        struct optparse_undo *undo = options->undo;
+        if (undo->len < undo->size) {
+            undo->log[undo->len * 2 + 0] = index;
+            undo->log[undo->len * 2 + 1] = options->optind;
+        }
+        undo->len++; /* keep counting to detect overflow */
+    }
+    OPTPARSE_TRACE(options, OPTPARSE_EVENT_PERMUTE,
+                   options->optind - 1 - index);
 }
+#endif /* OPTPARSE_NO_PERMUTE */
 
 static int
 optparse_argtype(const char *optstring, char c)
@@ -199,23 +602,28 @@ optparse(struct optparse *options, const char *optstring)
     char *next;
     char *option = options->argv[options->optind];
     options->errmsg[0] = '\0';
+    options->error = OPTPARSE_ENONE;
     options->optopt = 0;
     options->optarg = 0;
     if (option == 0) {
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
         return -1;
     } else if (optparse_is_dashdash(option)) {
         options->optind++; /* consume "--" */
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
         return -1;
     } else if (!optparse_is_shortopt(option)) {
+#ifndef OPTPARSE_NO_PERMUTE
         if (options->permute) {
             int index = options->optind++;
             int r = optparse(options, optstring);
             optparse_permute(options, index);
             options->optind--;
             return r;
-        } else {
-            return -1;
         }
+#endif
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
+        return -1;
     }
     option += options->subopt + 1;
     options->optopt = option[0];
@@ -226,7 +634,8 @@ optparse(struct optparse *options, const char *optstring)
         char str[2] = {0, 0};
         str[0] = option[0];
         options->optind++;
-        return optparse_error(options, OPTPARSE_MSG_INVALID, str);
+        return optparse_error(options, OPTPARSE_EINVALID,
+                              OPTPARSE_MSG_INVALID, str);
     }
     case OPTPARSE_NONE:
         if (option[1]) {
@@ -235,6 +644,7 @@ optparse(struct optparse *options, const char *optstring)
             options->subopt = 0;
             options->optind++;
         }
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_OPTION, option[0]);
         return option[0];
     case OPTPARSE_REQUIRED:
         options->subopt = 0;
@@ -248,8 +658,10 @@ optparse(struct optparse *options, const char *optstring)
             char str[2] = {0, 0};
             str[0] = option[0];
             options->optarg = 0;
-            return optparse_error(options, OPTPARSE_MSG_MISSING, str);
+            return optparse_error(options, OPTPARSE_EMISSING,
+                                  OPTPARSE_MSG_MISSING, str);
         }
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_OPTION, option[0]);
         return option[0];
     case OPTPARSE_OPTIONAL:
         options->subopt = 0;
@@ -258,6 +670,7 @@ optparse(struct optparse *options, const char *optstring)
             options->optarg = option + 1;
         else
             options->optarg = 0;
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_OPTION, option[0]);
         return option[0];
     }
     return 0;
@@ -274,39 +687,131 @@ optparse_arg(struct optparse *options)
     return option;
 }
 
-static int
-optparse_longopts_end(const struct optparse_long *longopts, int i)
+OPTPARSE_API
+void
+optparse_save(const struct optparse *options, struct optparse_state *state)
 {
-    return !longopts[i].longname && !longopts[i].shortname;
+    state->argv = options->argv;
+    state->optind = options->optind;
+    state->subopt = options->subopt;
+    state->permute = options->permute != 0;
+    state->error = (unsigned char)options->error;
 }
 
-static void
-optparse_from_long(const struct optparse_long *longopts, char *optstring)
+OPTPARSE_API
+void
+optparse_load(struct optparse *options, const struct optparse_state *state)
 {
-    char *p = optstring;
-    int i;
-    for (i = 0; !optparse_longopts_end(longopts, i); i++) {
-        if (longopts[i].shortname && longopts[i].shortname < 127) {
-            int a;
-            *p++ = (char)longopts[i].shortname;
-            for (a = 0; a < (int)longopts[i].argtype; a++)
-                *p++ = ':';
+    options->argv = state->argv;
+    options->optind = state->optind;
+    options->subopt = state->subopt;
+    options->permute = state->permute;
+    options->optopt = 0;
+    options->optarg = 0;
+    optparse_message(options, (enum optparse_errcode)state->error);
+    options->undo = 0;
+    options->shorts = 0;
+}
+
+OPTPARSE_API
+void
+optparse_snapshot(const struct optparse *options,
+                  struct optparse_snapshot *snapshot)
+{
+    optparse_save(options, &snapshot->state);
+    snapshot->undolen = options->undo ? options->undo->len : 0;
+}
+
+OPTPARSE_API
+int
+optparse_restore(struct optparse *options,
+                 const struct optparse_snapshot *snapshot)
+{
+    struct optparse_undo *undo = options->undo;
+    const struct optparse_shorts *shorts = options->shorts;
+    if (undo) {
+        if (undo->len > undo->size || undo->len < snapshot->undolen)
+            return 0;
+        for (; undo->len > snapshot->undolen; undo->len--) {
+            int index = undo->log[undo->len * 2 - 2];
+            int end = undo->log[undo->len * 2 - 1] - 1;
+            char *nonoption = options->argv[end];
+            for (; end > index; end--)
+                options->argv[end] = options->argv[end - 1];
+            options->argv[index] = nonoption;
         }
     }
-    *p = '\0';
+    optparse_load(options, &snapshot->state);
+    options->undo = undo;
+    options->shorts = shorts;
+    return 1;
+}
+
+#ifndef OPTPARSE_NO_LONG
+static int
+optparse_longopts_end(const struct optparse_long *longopts, int i)
+{
+    return !longopts[i].longname && !longopts[i].shortname;
 }
 
-/* Unlike strcmp(), handles options containing "=". */
+/* Unlike strcmp(), handles options containing "=" and names containing
+ * "|"-separated aliases.
+ */
 static int
 optparse_longopts_match(const char *longname, const char *option)
 {
-    const char *a = option, *n = longname;
+    const char *a, *n = longname;
     if (longname == 0)
         return 0;
-    for (; *a && *n && *a != '='; a++, n++)
-        if (*a != *n)
+    for (;;) {
+        for (a = option; *a && *a != '=' && *n != '|' && *a == *n; a++, n++);
+        if ((*n == '\0' || *n == '|') && (*a == '\0' || *a == '='))
+            return 1;
+        for (; *n && *n != '|'; n++);
+        if (*n++ == '\0')
             return 0;
-    return *n == '\0' && (*a == '\0' || *a == '=');
+    }
+}
+
+/* Match "no-" followed by a name of a negatable option. */
+static int
+optparse_longopts_negated(const struct optparse_long *longopt,
+                          const char *option)
+{
+    return longopt->argtype == OPTPARSE_NEGATABLE &&
+           option[0] == 'n' && option[1] == 'o' && option[2] == '-' &&
+           optparse_longopts_match(longopt->longname, option + 3);
+}
+
+/* Name an option for a message: its first long name, or else its
+ * shortname encoded as UTF-8. The buffer holds at least 5 bytes.
+ */
+static const char *
+optparse_name(const struct optparse_long *option, char *buf, unsigned size)
+{
+    long c = option->shortname;
+    char *p = buf;
+    if (option->longname) {
+        const char *n = option->longname;
+        for (; *n && *n != '|' && p < buf + size - 1; n++)
+            *p++ = *n;
+    } else if (c < 0x80) {
+        *p++ = (char)c;
+    } else if (c < 0x800) {
+        *p++ = (char)(0xc0 | c >> 6);
+        *p++ = (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        *p++ = (char)(0xe0 | c >> 12);
+        *p++ = (char)(0x80 | (c >> 6 & 0x3f));
+        *p++ = (char)(0x80 | (c & 0x3f));
+    } else {
+        *p++ = (char)(0xf0 | (c >> 18 & 0x07));
+        *p++ = (char)(0x80 | (c >> 12 & 0x3f));
+        *p++ = (char)(0x80 | (c >> 6 & 0x3f));
+        *p++ = (char)(0x80 | (c & 0x3f));
+    }
+    *p = '\0';
+    return buf;
 }
 
 /* Return the part after "=", or NULL. */
@@ -320,25 +825,176 @@ optparse_longopts_arg(char *option)
         return 0;
 }
 
+/* Decode one UTF-8 character, or return -1 if it is not valid UTF-8. */
+static int
+optparse_utf8(const char *s, int *len)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    int i, n, c;
+    *len = 1;
+    if (p[0] < 0x80)
+        return p[0];
+    if (p[0] < 0xc2 || p[0] > 0xf4)
+        return -1;
+    n = p[0] < 0xe0 ? 2 : p[0] < 0xf0 ? 3 : 4;
+    c = p[0] & (0x7f >> n);
+    for (i = 1; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80)
+            return -1;
+        c = c << 6 | (p[i] & 0x3f);
+    }
+    if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+        (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+        return -1; /* overlong, surrogate, or out of range */
+    *len = n;
+    return c;
+}
+
+static unsigned long
+optparse_shorts_hash(const struct optparse_shorts *shorts, int c)
+{
+    return ((unsigned long)c * 2654435761UL & 0xffffffffUL) %
+           (unsigned long)shorts->nslots;
+}
+
+/* Find the longopts index for shortname c, or -1. */
+static int
+optparse_shortname(const struct optparse_shorts *shorts,
+                   const struct optparse_long *longopts,
+                   int c)
+{
+    int i;
+    if (shorts && shorts->longopts == longopts) {
+        unsigned long s;
+        if (c < 128)
+            return shorts->ascii[c];
+        if (shorts->nslots == 0)
+            return -1;
+        s = optparse_shorts_hash(shorts, c);
+        for (; (i = shorts->slots[s]) != -1; s = (s + 1) % shorts->nslots)
+            if (longopts[i].shortname == c)
+                return i;
+        return -1;
+    }
+    for (i = 0; !optparse_longopts_end(longopts, i); i++)
+        if (longopts[i].shortname == c)
+            return i;
+    return -1;
+}
+
+/* Decode the short option at s, returning -1 if it cannot be one. */
+static int
+optparse_shortopt(const struct optparse_shorts *shorts,
+                  const struct optparse_long *longopts,
+                  const char *s,
+                  int *len)
+{
+    int c;
+    if (shorts && shorts->longopts == longopts && shorts->utf8)
+        return optparse_utf8(s, len);
+    *len = 1;
+    c = (unsigned char)s[0];
+    return c < 127 && c != ':' ? c : -1;
+}
+
+OPTPARSE_API
+int
+optparse_shorts_init(struct optparse_shorts *shorts,
+                     const struct optparse_long *longopts,
+                     int *slots,
+                     int nslots)
+{
+    int i, n = 0;
+    shorts->longopts = 0;
+    shorts->slots = slots;
+    shorts->nslots = nslots;
+    shorts->utf8 = 0;
+    for (i = 0; i < 128; i++)
+        shorts->ascii[i] = -1;
+    for (i = 0; i < nslots; i++)
+        slots[i] = -1;
+    for (i = 0; !optparse_longopts_end(longopts, i); i++) {
+        int c = longopts[i].shortname;
+        if (c > 0 && c < 128) {
+            if (shorts->ascii[c] == -1)
+                shorts->ascii[c] = i;
+        } else if (c >= 128 && c <= 0x10ffff) {
+            unsigned long s;
+            if (++n >= nslots)
+                return 0; /* an empty slot must remain */
+            s = optparse_shorts_hash(shorts, c);
+            for (; slots[s] != -1; s = (s + 1) % nslots)
+                if (longopts[slots[s]].shortname == c)
+                    break; /* the first of duplicates wins */
+            if (slots[s] == -1)
+                slots[s] = i;
+        }
+    }
+    shorts->longopts = longopts;
+    return 1;
+}
+
+/* Like optparse(), but looks up short options directly in longopts. */
 static int
 optparse_long_fallback(struct optparse *options,
                        const struct optparse_long *longopts,
                        int *longindex)
 {
-    int result;
-    char optstring[96 * 3 + 1]; /* 96 ASCII printable characters */
-    optparse_from_long(longopts, optstring);
-    result = optparse(options, optstring);
-    if (longindex != 0) {
-        *longindex = -1;
-        if (result != -1) {
-            int i;
-            for (i = 0; !optparse_longopts_end(longopts, i); i++)
-                if (longopts[i].shortname == options->optopt)
-                    *longindex = i;
+    int i, c, len;
+    char *option = options->argv[options->optind] + options->subopt + 1;
+    char *next = options->argv[options->optind + 1];
+    options->errmsg[0] = '\0';
+    options->error = OPTPARSE_ENONE;
+    options->optarg = 0;
+    c = optparse_shortopt(options->shorts, longopts, option, &len);
+    options->optopt = c == -1 ? (unsigned char)option[0] : c;
+    i = c == -1 ? -1 : optparse_shortname(options->shorts, longopts, c);
+    if (longindex)
+        *longindex = i;
+    if (i == -1) {
+        char str[5] = {0, 0, 0, 0, 0};
+        for (i = 0; i < len; i++)
+            str[i] = option[i];
+        options->optind++;
+        return optparse_error(options, OPTPARSE_EINVALID,
+                              OPTPARSE_MSG_INVALID, str);
+    }
+    OPTPARSE_TRACE(options, OPTPARSE_EVENT_LONGINDEX, i);
+    switch (longopts[i].argtype) {
+    case OPTPARSE_NONE:
+    case OPTPARSE_NEGATABLE:
+        if (option[len]) {
+            options->subopt += len;
+        } else {
+            options->subopt = 0;
+            options->optind++;
+        }
+        break;
+    case OPTPARSE_REQUIRED:
+        options->subopt = 0;
+        options->optind++;
+        if (option[len]) {
+            options->optarg = option + len;
+        } else if (next != 0) {
+            options->optarg = next;
+            options->optind++;
+        } else {
+            char str[5] = {0, 0, 0, 0, 0};
+            for (i = 0; i < len; i++)
+                str[i] = option[i];
+            return optparse_error(options, OPTPARSE_EMISSING,
+                                  OPTPARSE_MSG_MISSING, str);
         }
+        break;
+    case OPTPARSE_OPTIONAL:
+        options->subopt = 0;
+        options->optind++;
+        if (option[len])
+            options->optarg = option + len;
+        break;
     }
-    return result;
+    OPTPARSE_TRACE(options, OPTPARSE_EVENT_OPTION, c);
+    return c;
 }
 
 OPTPARSE_API
@@ -350,54 +1006,446 @@ optparse_long(struct optparse *options,
     int i;
     char *option = options->argv[options->optind];
     if (option == 0) {
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
         return -1;
     } else if (optparse_is_dashdash(option)) {
         options->optind++; /* consume "--" */
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
         return -1;
     } else if (optparse_is_shortopt(option)) {
         return optparse_long_fallback(options, longopts, longindex);
     } else if (!optparse_is_longopt(option)) {
+#ifndef OPTPARSE_NO_PERMUTE
         if (options->permute) {
             int index = options->optind++;
             int r = optparse_long(options, longopts, longindex);
             optparse_permute(options, index);
             options->optind--;
             return r;
-        } else {
-            return -1;
         }
+#endif
+        OPTPARSE_TRACE(options, OPTPARSE_EVENT_DONE, options->optind);
+        return -1;
     }
 
     /* Parse as long option. */
     options->errmsg[0] = '\0';
+    options->error = OPTPARSE_ENONE;
     options->optopt = 0;
     options->optarg = 0;
     option += 2; /* skip "--" */
     options->optind++;
     for (i = 0; !optparse_longopts_end(longopts, i); i++) {
-        const char *name = longopts[i].longname;
-        if (optparse_longopts_match(name, option)) {
+        int negated = optparse_longopts_negated(longopts + i, option);
+        if (negated || optparse_longopts_match(longopts[i].longname, option)) {
             char *arg;
+            char name[sizeof(options->errmsg)];
+            enum optparse_argtype type = longopts[i].argtype;
             if (longindex)
                 *longindex = i;
+            OPTPARSE_TRACE(options, OPTPARSE_EVENT_LONGINDEX, i);
             options->optopt = longopts[i].shortname;
             arg = optparse_longopts_arg(option);
-            if (longopts[i].argtype == OPTPARSE_NONE && arg != 0) {
-                return optparse_error(options, OPTPARSE_MSG_TOOMANY, name);
-            } if (arg != 0) {
+            if ((type == OPTPARSE_NONE || type == OPTPARSE_NEGATABLE) &&
+                arg != 0) {
+                optparse_name(longopts + i, name, sizeof(name));
+                return optparse_error(options, OPTPARSE_ETOOMANY,
+                                      OPTPARSE_MSG_TOOMANY, name);
+            } if (negated) {
+                options->optarg = option;
+            } else if (arg != 0) {
                 options->optarg = arg;
-            } else if (longopts[i].argtype == OPTPARSE_REQUIRED) {
+            } else if (type == OPTPARSE_REQUIRED) {
                 options->optarg = options->argv[options->optind];
-                if (options->optarg == 0)
-                    return optparse_error(options, OPTPARSE_MSG_MISSING, name);
-                else
+                if (options->optarg == 0) {
+                    optparse_name(longopts + i, name, sizeof(name));
+                    return optparse_error(options, OPTPARSE_EMISSING,
+                                          OPTPARSE_MSG_MISSING, name);
+                } else {
                     options->optind++;
+                }
             }
+            OPTPARSE_TRACE(options, OPTPARSE_EVENT_OPTION, options->optopt);
             return options->optopt;
         }
     }
-    return optparse_error(options, OPTPARSE_MSG_INVALID, option);
+    return optparse_error(options, OPTPARSE_EINVALID,
+                          OPTPARSE_MSG_INVALID, option);
+}
+
+OPTPARSE_API
+int
+optparse_complete(const struct optparse_long *longopts,
+                  const char *word,
+                  int index)
+{
+    if (word[0] != '-' || (word[1] != '\0' && word[1] != '-'))
+        return -1;
+    word += word[1] ? 2 : 1;
+    for (; !optparse_longopts_end(longopts, index); index++) {
+        const char *a = word, *n = longopts[index].longname;
+        if (n == 0)
+            continue;
+        for (; *a && *a == *n; a++, n++);
+        if (*a == '\0')
+            return index;
+    }
+    return -1;
+}
+
+OPTPARSE_API
+int
+optparse_complete_arg(const struct optparse_long *longopts,
+                      const char *word)
+{
+    int i;
+    if (optparse_is_longopt(word)) {
+        if (optparse_longopts_arg((char *)word))
+            return -1;
+        for (i = 0; !optparse_longopts_end(longopts, i); i++)
+            if (optparse_longopts_match(longopts[i].longname, word + 2))
+                return longopts[i].argtype == OPTPARSE_REQUIRED ? i : -1;
+    } else if (optparse_is_shortopt(word)) {
+        int c, len;
+        for (word++; *word; word += len) {
+            c = optparse_shortopt(0, longopts, word, &len);
+            i = c == -1 ? -1 : optparse_shortname(0, longopts, c);
+            if (i == -1)
+                return -1;
+            if (longopts[i].argtype == OPTPARSE_OPTIONAL)
+                return -1;
+            if (longopts[i].argtype == OPTPARSE_REQUIRED)
+                return word[len] ? -1 : i;
+        }
+    }
+    return -1;
+}
+
+#ifndef OPTPARSE_NO_ERRMSG
+/* Append to a NUL-terminated buffer, returning the new length. */
+static unsigned
+optparse_append(char *buf, unsigned len, unsigned size, const char *s)
+{
+    while (len < size - 1 && *s)
+        buf[len++] = *s++;
+    buf[len] = '\0';
+    return len;
+}
+#endif
+
+static enum optparse_errcode
+optparse_rule_errcode(const struct optparse_rule *rule)
+{
+    switch (rule->type) {
+    case OPTPARSE_REQUIRES:
+        return OPTPARSE_EREQUIRES;
+    case OPTPARSE_CONFLICTS:
+        return OPTPARSE_ECONFLICTS;
+    default:
+        return OPTPARSE_EANYOF;
+    }
+}
+
+/* Describe a violated rule in errmsg. */
+static void
+optparse_rule_error(struct optparse *options,
+                    const struct optparse_long *longopts,
+                    const struct optparse_rule *rule)
+{
+#ifndef OPTPARSE_NO_ERRMSG
+    char msg[sizeof(options->errmsg)];
+    char data[sizeof(options->errmsg)];
+    char name[sizeof(options->errmsg)];
+    const char *a = optparse_name(longopts + rule->a, data, sizeof(data));
+    const char *b = optparse_name(longopts + rule->b, name, sizeof(name));
+    unsigned p;
+
+    /* Option a is always reported. Option b is named in the message,
+     * or listed after option a when either of them would do.
+     */
+    if (rule->type == OPTPARSE_REQUIRES) {
+        p = optparse_append(msg, 0, sizeof(msg), OPTPARSE_MSG_REQUIRES);
+        p = optparse_append(msg, p, sizeof(msg), b);
+        optparse_append(msg, p, sizeof(msg), "'");
+    } else if (rule->type == OPTPARSE_CONFLICTS) {
+        p = optparse_append(msg, 0, sizeof(msg), OPTPARSE_MSG_CONFLICTS);
+        p = optparse_append(msg, p, sizeof(msg), b);
+        optparse_append(msg, p, sizeof(msg), "'");
+    } else if (rule->a == rule->b) {
+        optparse_append(msg, 0, sizeof(msg), OPTPARSE_MSG_ANYOF);
+    } else {
+        optparse_append(msg, 0, sizeof(msg), OPTPARSE_MSG_ONEOF);
+        for (p = 0; a[p]; p++);
+        p = optparse_append(data, p, sizeof(data), "', '");
+        optparse_append(data, p, sizeof(data), b);
+    }
+    optparse_error(options, optparse_rule_errcode(rule), msg, data);
+#else
+    (void)longopts;
+    optparse_error(options, optparse_rule_errcode(rule), "", "");
+#endif
+}
+
+OPTPARSE_API
+int
+optparse_check(struct optparse *options,
+               const struct optparse_long *longopts,
+               const struct optparse_rule *rules,
+               const unsigned char *seen)
+{
+    int i;
+    for (i = 0; rules[i].type || rules[i].a || rules[i].b; i++) {
+        int a = rules[i].a, b = rules[i].b;
+        int has_a = seen[a / 8] >> a % 8 & 1;
+        int has_b = seen[b / 8] >> b % 8 & 1;
+        int violated = 0;
+        switch (rules[i].type) {
+        case OPTPARSE_REQUIRES:
+            violated = has_a && !has_b;
+            break;
+        case OPTPARSE_CONFLICTS:
+            violated = has_a && has_b;
+            break;
+        case OPTPARSE_ANYOF:
+            violated = !has_a && !has_b;
+            break;
+        }
+        if (violated) {
+            options->optopt = longopts[a].shortname;
+            optparse_rule_error(options, longopts, rules + i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Parse argv into items without permuting it. Returns the number of
+ * items, which may exceed max, or -1 on error.
+ */
+static int
+optparse_walk(struct optparse *options,
+              const struct optparse_long *longopts,
+              struct optparse_item *items,
+              int max)
+{
+    int n = 0, permute = options->permute;
+    options->permute = 0;
+    for (;;) {
+        int option, longindex, optind = options->optind;
+        option = optparse_long(options, longopts, &longindex);
+        if (option == '?') {
+            n = -1;
+            break;
+        } else if (option != -1) {
+            if (n < max) {
+                items[n].option = option;
+                items[n].longindex = longindex;
+                items[n].argind = -1;
+                items[n].argoff = 0;
+                if (options->optarg) {
+                    char **argv = options->argv;
+                    items[n].argind = options->optind - 1;
+                    items[n].argoff = (int)(options->optarg -
+                                            argv[options->optind - 1]);
+                }
+            }
+            n++;
+        } else if (!options->argv[options->optind]) {
+            break;
+        } else {
+            /* A non-option argument, or all of them after "--". */
+            int rest = options->optind > optind || !permute;
+            do {
+                if (n < max) {
+                    items[n].option = 0;
+                    items[n].longindex = -1;
+                    items[n].argind = options->optind;
+                    items[n].argoff = 0;
+                }
+                options->optind++;
+                n++;
+            } while (rest && options->argv[options->optind]);
+        }
+    }
+    options->permute = permute;
+    return n;
+}
+
+OPTPARSE_API
+int
+optparse_cached(struct optparse *options,
+                const struct optparse_long *longopts,
+                struct optparse_cache *cache,
+                const struct optparse_item **items)
+{
+    unsigned long hash = 2166136261UL, length = 0;
+    struct optparse_memo *memo;
+    struct optparse_item *slot;
+    char **argv;
+    int count;
+
+    /* FNV-1a over the arguments, each including its terminator. */
+    for (argv = options->argv + options->optind; *argv; argv++) {
+        const char *p = *argv;
+        do {
+            hash = (hash ^ (unsigned char)*p) * 16777619UL;
+            length++;
+        } while (*p++);
+    }
+    hash ^= (unsigned long)options->permute;
+    hash = (hash ^ (unsigned long)options->optind) * 16777619UL;
+    hash = (hash ^ (unsigned long)options->subopt) * 16777619UL;
+    if (options->shorts && options->shorts->longopts == longopts)
+        hash ^= (unsigned long)options->shorts->utf8 << 1;
+
+    memo = cache->memos + hash % (unsigned long)cache->nslots;
+    slot = cache->items + (memo - cache->memos) * cache->depth;
+    *items = slot;
+    if (memo->longopts == longopts && memo->hash == hash &&
+        memo->length == length) {
+        /* Leave the parser where a full parse would. */
+        options->optind = (int)(argv - options->argv);
+        options->subopt = 0;
+        options->optopt = 0;
+        options->optarg = 0;
+        optparse_message(options, OPTPARSE_ENONE);
+        return memo->count;
+    }
+
+    memo->longopts = 0;
+    count = optparse_walk(options, longopts, slot, cache->depth);
+    if (count > cache->depth) {
+        optparse_message(options, OPTPARSE_EDEPTH);
+        return -1;
+    } else if (count >= 0) {
+        memo->hash = hash;
+        memo->length = length;
+        memo->longopts = longopts;
+        memo->count = count;
+    }
+    return count;
+}
+
+/* FNV-1a over a name, ending at "|" or the end of the string. */
+static unsigned long
+optparse_index_hash(const struct optparse_index *index, const char *name)
+{
+    unsigned long hash = 2166136261UL;
+    for (; *name && *name != '|'; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619UL;
+    return (hash & 0xffffffffUL) % (unsigned long)index->nslots;
+}
+
+/* Find the longopts index with the given long name, or -1. */
+static int
+optparse_index_find(const struct optparse_index *index, const char *name)
+{
+    int i;
+    unsigned long s;
+    if (index->nslots == 0)
+        return -1;
+    s = optparse_index_hash(index, name);
+    for (; (i = index->slots[s]) != -1; s = (s + 1) % index->nslots)
+        if (optparse_longopts_match(index->longopts[i].longname, name))
+            return i;
+    return -1;
+}
+
+OPTPARSE_API
+int
+optparse_index_init(struct optparse_index *index,
+                    char **argv,
+                    const struct optparse_long *longopts,
+                    int *counts,
+                    char **values,
+                    int *slots,
+                    int nslots)
+{
+    int i, n = 0;
+    index->argv = argv;
+    index->longopts = longopts;
+    index->counts = counts;
+    index->values = values;
+    index->slots = slots;
+    index->nslots = nslots;
+    index->built = 0;
+    for (i = 0; i < nslots; i++)
+        slots[i] = -1;
+    for (i = 0; !optparse_longopts_end(longopts, i); i++) {
+        const char *name = longopts[i].longname;
+        counts[i] = 0;
+        values[i] = 0;
+        while (name) {
+            unsigned long s;
+            const char *end = name;
+            for (; *end && *end != '|'; end++);
+            if (++n >= nslots) {
+                index->nslots = 0;
+                return 0; /* an empty slot must remain */
+            }
+            /* Probing finds duplicates in insertion order, so the
+             * first entry with a name wins, as in optparse_long().
+             */
+            s = optparse_index_hash(index, name);
+            for (; slots[s] != -1; s = (s + 1) % nslots);
+            slots[s] = i;
+            name = *end ? end + 1 : 0;
+        }
+    }
+    return 1;
+}
+
+/* Record every option in argv, leaving argv unpermuted. */
+static int
+optparse_index_build(struct optparse_index *index)
+{
+    struct optparse options;
+    optparse_init(&options, index->argv);
+    options.permute = 0;
+    for (;;) {
+        int longindex, optind = options.optind;
+        int option = optparse_long(&options, index->longopts, &longindex);
+        if (option == '?') {
+            return -1;
+        } else if (option != -1) {
+            index->counts[longindex]++;
+            index->values[longindex] = options.optarg;
+        } else if (!options.argv[options.optind] || options.optind > optind) {
+            return 1; /* end of argv, or after "--" */
+        } else {
+            options.optind++; /* skip a non-option argument */
+        }
+    }
+}
+
+OPTPARSE_API
+int
+optparse_lookup(struct optparse_index *index,
+                const char *name,
+                char **optarg)
+{
+    int i;
+    if (!index->built)
+        index->built = optparse_index_build(index);
+    if (optarg)
+        *optarg = 0;
+    if (index->built == -1)
+        return -1;
+    i = optparse_index_find(index, name);
+    if (name[0] == 'n' && name[1] == 'o' && name[2] == '-') {
+        /* The parser takes whichever entry comes first. */
+        int j = optparse_index_find(index, name + 3);
+        if (j != -1 && (i == -1 || j < i) &&
+            index->longopts[j].argtype == OPTPARSE_NEGATABLE)
+            i = j;
+    }
+    if (i == -1)
+        return 0;
+    if (optarg)
+        *optarg = index->values[i];
+    return index->counts[i];
 }
 
+#endif /* OPTPARSE_NO_LONG */
 #endif /* OPTPARSE_IMPLEMENTATION */
 #endif /* OPTPARSE_H */
@@ -0,0 +1,171 @@
+/* Optparse --- C++20 range interface to Optparse
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Include this header instead of optparse.h. The C implementation is
+ * included inline into namespace optparse::detail, so no translation
+ * unit needs to define OPTPARSE_IMPLEMENTATION and the compiler sees the
+ * whole parser at every call site.
+ *
+ * Options are presented as a lazy input range, and the remaining
+ * non-option arguments as a second range over optparse_arg():
+ *
+ *   static constexpr optparse::spec longopts[] = {
+ *       {"amend", 'a', optparse::none},
+ *       {"color", 'c', optparse::required},
+ *       {},
+ *   };
+ *   auto parser = optparse::options(argv, longopts);
+ *   for (auto [opt, arg, index] : parser) {
+ *       ...
+ *   }
+ *   for (char *arg : parser.args()) {
+ *       ...
+ *   }
+ *
+ * Nothing is allocated. The parser state lives in the object returned
+ * by options(), which must outlive both loops.
+ */
+#ifndef OPTPARSE_HPP
+#define OPTPARSE_HPP
+
+#ifdef OPTPARSE_H
+#  error "optparse.hpp must be included instead of optparse.h"
+#endif
+
+#include <cstddef>
+#include <iterator>
+
+namespace optparse {
+
+namespace detail {
+#undef OPTPARSE_API
+#define OPTPARSE_API static inline
+#define OPTPARSE_IMPLEMENTATION
+#include "optparse.h"
+#undef OPTPARSE_IMPLEMENTATION
+#undef OPTPARSE_API
+}
+
+using spec = struct detail::optparse_long;
+using argtype = enum detail::optparse_argtype;
+
+inline constexpr argtype none = detail::OPTPARSE_NONE;
+inline constexpr argtype required = detail::OPTPARSE_REQUIRED;
+inline constexpr argtype optional = detail::OPTPARSE_OPTIONAL;
+inline constexpr argtype negatable = detail::OPTPARSE_NEGATABLE;
+
+/* One parsed option, as returned by optparse_long(). */
+struct option {
+    int opt;
+    char *arg;
+    int index;
+};
+
+class parser {
+public:
+    struct sentinel {};
+
+    class iterator {
+    public:
+        using value_type = option;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(parser *p) : p(p) { ++*this; }
+
+        const option &operator*() const { return current; }
+        const option *operator->() const { return &current; }
+
+        iterator &operator++()
+        {
+            current.index = -1;
+            current.opt = detail::optparse_long(&p->state, p->longopts,
+                                                &current.index);
+            current.arg = p->state.optarg;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(const iterator &i, sentinel)
+        {
+            return i.current.opt == -1;
+        }
+
+    private:
+        parser *p = nullptr;
+        option current = {-1, nullptr, -1};
+    };
+
+    class arg_range {
+    public:
+        class iterator {
+        public:
+            using value_type = char *;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(struct detail::optparse *s) : s(s) { ++*this; }
+
+            char *operator*() const { return current; }
+
+            iterator &operator++()
+            {
+                current = detail::optparse_arg(s);
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+
+            friend bool operator==(const iterator &i, sentinel)
+            {
+                return i.current == nullptr;
+            }
+
+        private:
+            struct detail::optparse *s = nullptr;
+            char *current = nullptr;
+        };
+
+        explicit arg_range(struct detail::optparse *s) : s(s) {}
+        iterator begin() { return iterator(s); }
+        sentinel end() { return {}; }
+
+    private:
+        struct detail::optparse *s;
+    };
+
+    parser(char **argv, const spec *longopts) : longopts(longopts)
+    {
+        detail::optparse_init(&state, argv);
+    }
+
+    iterator begin() { return iterator(this); }
+    sentinel end() { return {}; }
+
+    /* Non-option arguments, to be iterated after the options. */
+    arg_range args() { return arg_range(&state); }
+
+    /* Message for the most recent '?' option. */
+    const char *errmsg() const { return state.errmsg; }
+
+    /* The underlying C parser, such as for disabling permutation. */
+    struct detail::optparse &c_state() { return state; }
+
+private:
+    struct detail::optparse state;
+    const spec *longopts;
+};
+
+inline parser
+options(char **argv, const spec *longopts)
+{
+    return parser(argv, longopts);
+}
+
+static_assert(std::input_iterator<parser::iterator>);
+static_assert(std::sentinel_for<parser::sentinel, parser::iterator>);
+static_assert(std::input_iterator<parser::arg_range::iterator>);
+
+} // namespace optparse
+
+#endif /* OPTPARSE_HPP */
@@ -285,10 +285,689 @@ testsuite(void)
         }
     }
 
-    if (nfails == 0) {
-        puts("All tests pass.");
+    return nfails;
+}
+
+static int
+utf8_tests(void)
+{
+    /* Modes: 0 scans longopts, 1 uses a table, 2 also decodes UTF-8. */
+    struct {
+        int mode;
+        char *argv[4];
+        int opts[4];
+        char *optarg;
+        char *err;
+    } t[] = {
+        {2, {"", "-\316\273\316\273x", 0},       {0x3bb, 0x3bb, 'x', -1}, 0, 0},
+        {2, {"", "-\303\251foo", 0},             {0xe9, -1},             "foo", 0},
+        {2, {"", "-\316\273\303\251", "bar", 0}, {0x3bb, 0xe9, -1},      "bar", 0},
+        {2, {"", "--long", 0},                   {0x110000, -1},         0, 0},
+        {2, {"", "-\303\251", 0},                {'?', -1},              0,
+         OPTPARSE_MSG_MISSING " -- '\303\251'"},
+        {2, {"", "-\342\202\254", 0},            {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\342\202\254'"},
+        {2, {"", "-\377", 0},                    {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\377'"},
+        {2, {"", "-\304\200", 0},                {256, -1},              0, 0},
+        {2, {"", "-\316x", 0},                   {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\316'"},
+        {2, {"", "-\300\200", 0},                {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\300'"},
+        {2, {"", "-\355\240\200", 0},            {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\355'"},
+        {1, {"", "-x", "--long", 0},             {'x', 0x110000, -1},    0, 0},
+        {1, {"", "-\304\200", 0},                {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\304'"},
+        {0, {"", "-x", 0},                       {'x', -1},              0, 0},
+        {0, {"", "-\303\251foo", 0},             {'?', -1},              0,
+         OPTPARSE_MSG_INVALID " -- '\303'"},
+    };
+    int ntests = sizeof(t) / sizeof(*t);
+    int i, slots[8], nfails = 0;
+    struct optparse_shorts shorts;
+    struct optparse_long longopts[] = {
+        {"\303\251t\303\251", 0xe9,     OPTPARSE_REQUIRED},
+        {"\316\273",         0x3bb,    OPTPARSE_NONE},
+        {"long",             0x110000, OPTPARSE_NONE},
+        {"x",                'x',      OPTPARSE_NONE},
+        {"code",             256,      OPTPARSE_NONE},
+        {"dup",              0x3bb,    OPTPARSE_NONE},
+        {0, 0, 0}
+    };
+
+    if (!optparse_shorts_init(&shorts, longopts, slots, 5) ||
+        optparse_shorts_init(&shorts, longopts, slots, 4)) {
+        nfails++;
+        printf("FAIL: expected 4 shortnames to need 5 slots\n");
+    }
+    optparse_shorts_init(&shorts, longopts, slots, 8);
+
+    for (i = 0; i < ntests; i++) {
+        int j, opt, longindex;
+        char *optarg = 0;
+        struct optparse options;
+
+        optparse_init(&options, t[i].argv);
+        if (t[i].mode)
+            options.shorts = &shorts;
+        shorts.utf8 = t[i].mode == 2;
+        for (j = 0; j < 4; j++) {
+            opt = optparse_long(&options, longopts, &longindex);
+            if (opt != t[i].opts[j]) {
+                nfails++;
+                printf("FAIL (%2d): expected option %d, got %d\n",
+                       i, t[i].opts[j], opt);
+            }
+            if (opt == 0x3bb && longindex != 1) {
+                nfails++;
+                printf("FAIL (%2d): expected longindex 1, got %d\n",
+                       i, longindex);
+            }
+            if (options.optarg)
+                optarg = options.optarg;
+            if (opt == '?' && strcmp(options.errmsg, t[i].err)) {
+                nfails++;
+                printf("FAIL (%2d): expected error '%s', got '%s'\n",
+                       i, t[i].err, options.errmsg);
+            }
+            if (opt == -1 || opt == '?')
+                break;
+        }
+        if (t[i].optarg && (!optarg || strcmp(optarg, t[i].optarg))) {
+            nfails++;
+            printf("FAIL (%2d): expected optarg %s, got %s\n",
+                   i, t[i].optarg, optarg ? optarg : "(nil)");
+        }
+    }
+    return nfails;
+}
+
+static int
+check_tests(void)
+{
+    struct {
+        char *argv[6];
+        int rule;
+        char *err;
+    } t[] = {
+        {{"", "-abe", "-d", "1", 0},      -1, 0},
+        {{"", "-c", "-d", "1", 0},        -1, 0},
+        {{"", "-ad", "1", 0},             0,
+         OPTPARSE_MSG_REQUIRES "brief' -- 'amend'"},
+        {{"", "-abc", "-d1", 0},          1,
+         OPTPARSE_MSG_CONFLICTS "color' -- 'brief'"},
+        {{"", "-a", "-b", 0},             2,
+         OPTPARSE_MSG_ANYOF " -- 'delay'"},
+        {{"", "-d", "1", 0},              3,
+         OPTPARSE_MSG_ONEOF " -- 'color', 'e'"},
+        {{"", "-ed", "1", 0},             -1, 0},
+    };
+    int ntests = sizeof(t) / sizeof(*t);
+    int i, nfails = 0;
+    struct optparse_long longopts[] = {
+        {"amend", 'a', OPTPARSE_NONE},
+        {"brief", 'b', OPTPARSE_NONE},
+        {"color", 'c', OPTPARSE_OPTIONAL},
+        {"delay", 'd', OPTPARSE_REQUIRED},
+        {0,       'e', OPTPARSE_NONE},
+        {0, 0, 0}
+    };
+    struct optparse_rule rules[] = {
+        {OPTPARSE_REQUIRES,  0, 1},
+        {OPTPARSE_CONFLICTS, 1, 2},
+        {OPTPARSE_ANYOF,     3, 3},
+        {OPTPARSE_ANYOF,     2, 4},
+        {0, 0, 0}
+    };
+
+    for (i = 0; i < ntests; i++) {
+        int rule, longindex;
+        unsigned char seen[1] = {0};
+        struct optparse options;
+
+        optparse_init(&options, t[i].argv);
+        while (optparse_long(&options, longopts, &longindex) != -1)
+            seen[longindex / 8] |= 1 << longindex % 8;
+
+        rule = optparse_check(&options, longopts, rules, seen);
+        if (rule != t[i].rule) {
+            nfails++;
+            printf("FAIL (%2d): expected rule %d violated, got %d\n",
+                   i, t[i].rule, rule);
+        }
+        if (t[i].err && strcmp(options.errmsg, t[i].err)) {
+            nfails++;
+            printf("FAIL (%2d): expected error '%s', got '%s'\n",
+                   i, t[i].err, options.errmsg);
+        }
+    }
+    return nfails;
+}
+
+static int
+negation_tests(void)
+{
+    struct {
+        char *argv[4];
+        int opt;
+        char *optarg;
+        char *err;
+    } t[] = {
+        {{"", "--color", 0},           'c', 0,          0},
+        {{"", "--no-color", 0},        'c', "no-color", 0},
+        {{"", "--colour", 0},          'c', 0,          0},
+        {{"", "--no-colour", 0},       'c', "no-colour", 0},
+        {{"", "-c", 0},                'c', 0,          0},
+        {{"", "--wait", "5", 0},       'd', "5",        0},
+        {{"", "--delay=5", 0},         'd', "5",        0},
+        {{"", "--no-wait", 0},         '?', 0,
+         OPTPARSE_MSG_INVALID " -- 'no-wait'"},
+        {{"", "--wait", 0},            '?', 0,
+         OPTPARSE_MSG_MISSING " -- 'delay'"},
+        {{"", "--no-colour=x", 0},     '?', 0,
+         OPTPARSE_MSG_TOOMANY " -- 'color'"},
+        {{"", "--color|colour", 0},    '?', 0,
+         OPTPARSE_MSG_INVALID " -- 'color|colour'"},
+    };
+    int ntests = sizeof(t) / sizeof(*t);
+    int i, nfails = 0;
+    struct optparse_long longopts[] = {
+        {"color|colour", 'c', OPTPARSE_NEGATABLE},
+        {"delay|wait",   'd', OPTPARSE_REQUIRED},
+        {0, 0, 0}
+    };
+
+    for (i = 0; i < ntests; i++) {
+        int opt;
+        struct optparse options;
+
+        optparse_init(&options, t[i].argv);
+        opt = optparse_long(&options, longopts, 0);
+        if (opt != t[i].opt) {
+            nfails++;
+            printf("FAIL (%2d): expected option %d, got %d\n",
+                   i, t[i].opt, opt);
+        }
+        if (t[i].optarg ? !options.optarg || strcmp(options.optarg,
+                                                    t[i].optarg)
+                        : options.optarg != 0) {
+            nfails++;
+            printf("FAIL (%2d): expected optarg %s, got %s\n",
+                   i, t[i].optarg ? t[i].optarg : "(nil)",
+                   options.optarg ? options.optarg : "(nil)");
+        }
+        if (t[i].err && strcmp(options.errmsg, t[i].err)) {
+            nfails++;
+            printf("FAIL (%2d): expected error '%s', got '%s'\n",
+                   i, t[i].err, options.errmsg);
+        }
+    }
+    return nfails;
+}
+
+static int
+state_tests(void)
+{
+    char *argv[] = {
+        "", "foo", "-ab", "--color=red", "-x", "bar", "-d", 0
+    };
+    char *argv_copy[sizeof(argv) / sizeof(*argv)];
+    int expect[] = {'a', 'b', 'c', '?', '?', -1};
+    /* As with errmsg, the final -1 leaves the last error in place. */
+    enum optparse_errcode errors[] = {
+        OPTPARSE_ENONE, OPTPARSE_ENONE, OPTPARSE_ENONE,
+        OPTPARSE_EINVALID, OPTPARSE_EMISSING, OPTPARSE_EMISSING
+    };
+    char *args[] = {"foo", "bar", 0};
+    int i, nfails = 0;
+    struct optparse_state state;
+    struct optparse_long longopts[] = {
+        {"amend", 'a', OPTPARSE_NONE},
+        {"brief", 'b', OPTPARSE_NONE},
+        {"color", 'c', OPTPARSE_OPTIONAL},
+        {"delay", 'd', OPTPARSE_REQUIRED},
+        {0, 0, 0}
+    };
+
+    memcpy(argv_copy, argv, sizeof(argv));
+    {
+        struct optparse options;
+        optparse_init(&options, argv_copy);
+        optparse_save(&options, &state);
+    }
+
+    /* Resume from the compact state for every option. */
+    for (i = 0; i < (int)(sizeof(expect) / sizeof(*expect)); i++) {
+        struct optparse options;
+        int opt;
+        optparse_load(&options, &state);
+        opt = optparse_long(&options, longopts, 0);
+        optparse_save(&options, &state);
+        if (opt != expect[i]) {
+            nfails++;
+            printf("FAIL (%2d): expected option %d, got %d\n",
+                   i, expect[i], opt);
+        }
+        if (state.error != errors[i]) {
+            nfails++;
+            printf("FAIL (%2d): expected error code %d, got %d\n",
+                   i, (int)errors[i], state.error);
+        }
+        if (errors[i]) {
+            optparse_load(&options, &state);
+            if (strcmp(options.errmsg, optparse_messages[errors[i]])) {
+                nfails++;
+                printf("FAIL (%2d): expected error '%s', got '%s'\n",
+                       i, optparse_messages[errors[i]], options.errmsg);
+            }
+        }
+    }
+
+    for (i = 0; args[i]; i++) {
+        char *arg;
+        struct optparse options;
+        optparse_load(&options, &state);
+        arg = optparse_arg(&options);
+        optparse_save(&options, &state);
+        if (!arg || strcmp(arg, args[i])) {
+            nfails++;
+            printf("FAIL: expected arg %s, got %s\n",
+                   args[i], arg ? arg : "(nil)");
+        }
+    }
+
+    /* Errors outside of parsing are saved by code too. */
+    {
+        struct optparse options;
+        unsigned char seen[1] = {1};
+        struct optparse_rule rules[] = {
+            {OPTPARSE_REQUIRES, 0, 1},
+            {0, 0, 0}
+        };
+        optparse_init(&options, argv);
+        optparse_check(&options, longopts, rules, seen);
+        optparse_save(&options, &state);
+        if (state.error != OPTPARSE_EREQUIRES) {
+            nfails++;
+            printf("FAIL: expected error code %d, got %d\n",
+                   (int)OPTPARSE_EREQUIRES, state.error);
+        }
+    }
+
+    /* The shorts table is cleared by a load and must be attached again. */
+    {
+        char *utf8_argv[] = {"", "-\316\273", "-\316\273", 0};
+        int slots[2];
+        struct optparse options;
+        struct optparse_shorts shorts;
+        struct optparse_long utf8_longopts[] = {
+            {"lambda", 0x3bb, OPTPARSE_NONE},
+            {0, 0, 0}
+        };
+        optparse_shorts_init(&shorts, utf8_longopts, slots, 2);
+        shorts.utf8 = 1;
+        optparse_init(&options, utf8_argv);
+        options.shorts = &shorts;
+        optparse_long(&options, utf8_longopts, 0);
+        optparse_save(&options, &state);
+        optparse_load(&options, &state);
+        if (options.shorts || options.undo) {
+            nfails++;
+            printf("FAIL: expected load to clear shorts and undo\n");
+        }
+        options.shorts = &shorts;
+        if (optparse_long(&options, utf8_longopts, 0) != 0x3bb) {
+            nfails++;
+            printf("FAIL: expected UTF-8 option after attaching shorts\n");
+        }
+    }
+
+    /* A cluster of more than 65535 options survives save and load. */
+    {
+        static char cluster[70002];
+        char *cluster_argv[3];
+        struct optparse options;
+        long count = 0;
+        int opt;
+        cluster[0] = '-';
+        memset(cluster + 1, 'a', 70000);
+        cluster_argv[0] = "";
+        cluster_argv[1] = cluster;
+        cluster_argv[2] = 0;
+        optparse_init(&options, cluster_argv);
+        optparse_save(&options, &state);
+        do {
+            optparse_load(&options, &state);
+            opt = optparse_long(&options, longopts, 0);
+            optparse_save(&options, &state);
+        } while (opt == 'a' && ++count <= 70000);
+        if (count != 70000 || opt != -1) {
+            nfails++;
+            printf("FAIL: expected 70000 options, got %ld then %d\n",
+                   count, opt);
+        }
+    }
+    return nfails;
+}
+
+static int
+snapshot_tests(void)
+{
+    char *argv[] = {"", "x", "-a", "y", "z", "-b", "--color", "w", "-d1", 0};
+    char *copy[sizeof(argv) / sizeof(*argv)];
+    int i, n, log[32 * 2], nfails = 0;
+    struct optparse options;
+    struct optparse_snapshot start, middle;
+    struct optparse_undo undo;
+    struct optparse_long longopts[] = {
+        {"amend", 'a', OPTPARSE_NONE},
+        {"brief", 'b', OPTPARSE_NONE},
+        {"color", 'c', OPTPARSE_OPTIONAL},
+        {"delay", 'd', OPTPARSE_REQUIRED},
+        {0, 0, 0}
+    };
+
+    memcpy(copy, argv, sizeof(argv));
+    undo.log = log;
+    undo.size = 32;
+    undo.len = 0;
+    optparse_init(&options, copy);
+    options.undo = &undo;
+    optparse_snapshot(&options, &start);
+    optparse_long(&options, longopts, 0);
+    optparse_snapshot(&options, &middle);
+    while (optparse_long(&options, longopts, 0) != -1);
+
+    /* Return to the middle and parse the rest again. */
+    if (!optparse_restore(&options, &middle)) {
+        nfails++;
+        printf("FAIL: could not restore middle snapshot\n");
+    }
+    for (n = 0; optparse_long(&options, longopts, 0) != -1; n++);
+    if (n != 3) {
+        nfails++;
+        printf("FAIL: expected 3 options after restore, got %d\n", n);
+    }
+
+    /* Return to the start, which must undo every permutation. */
+    if (!optparse_restore(&options, &start)) {
+        nfails++;
+        printf("FAIL: could not restore start snapshot\n");
+    }
+    for (i = 0; argv[i]; i++) {
+        if (copy[i] != argv[i]) {
+            nfails++;
+            printf("FAIL: expected argv[%d] %s, got %s\n",
+                   i, argv[i], copy[i]);
+        }
+    }
+    if (options.optind != 1 || options.undo->len != 0) {
+        nfails++;
+        printf("FAIL: expected optind 1 and empty log, got %d and %d\n",
+               options.optind, options.undo->len);
+    }
+
+    /* The middle snapshot is now ahead of the parser, so it is gone. */
+    if (optparse_restore(&options, &middle) || options.optind != 1) {
+        nfails++;
+        printf("FAIL: expected restore of a later snapshot to fail\n");
+    }
+
+    /* An overflowed log cannot be undone. */
+    undo.size = 1;
+    while (optparse_long(&options, longopts, 0) != -1);
+    if (optparse_restore(&options, &start)) {
+        nfails++;
+        printf("FAIL: expected restore to fail after overflow\n");
+    }
+    return nfails;
+}
+
+static int
+cache_tests(void)
+{
+    char a1[] = "-ab", a2[] = "--color=red", a3[] = "-d";
+    char *first[] = {"", "x", "-ab", "--color=red", "y", "-d", "1", 0};
+    char *second[] = {"", "x", 0, 0, "y", 0, "1", 0};
+    char *cluster[] = {"", "-ab", 0};
+    char *dashdash[] = {"", "-a", "--", "-b", 0};
+    char *invalid[] = {"", "-a", "-x", 0};
+    char *deep[] = {"", "1", "2", "3", "4", "5", "6", "7", "8", "9", 0};
+    struct optparse_item expect[] = {
+        {0,   -1, 1, 0},
+        {'a', 0,  -1, 0},
+        {'b', 1,  -1, 0},
+        {'c', 2,  3, 8},
+        {0,   -1, 4, 0},
+        {'d', 3,  6, 0},
+    };
+    int i, n, nfails = 0;
+    struct optparse_memo memos[4];
+    struct optparse_item storage[4 * 8];
+    struct optparse_cache cache;
+    const struct optparse_item *items, *cached;
+    struct optparse options;
+    struct optparse_long longopts[] = {
+        {"amend", 'a', OPTPARSE_NONE},
+        {"brief", 'b', OPTPARSE_NONE},
+        {"color", 'c', OPTPARSE_OPTIONAL},
+        {"delay", 'd', OPTPARSE_REQUIRED},
+        {0, 0, 0}
+    };
+
+    second[2] = a1;
+    second[3] = a2;
+    second[5] = a3;
+    memset(memos, 0, sizeof(memos));
+    cache.memos = memos;
+    cache.items = storage;
+    cache.nslots = 4;
+    cache.depth = 8;
+
+    /* The second argv has the same contents, so it must hit the cache. */
+    optparse_init(&options, first);
+    n = optparse_cached(&options, longopts, &cache, &items);
+    storage[items - storage].argoff = 99; /* poison the cached results */
+    optparse_init(&options, second);
+    if (optparse_cached(&options, longopts, &cache, &cached) != n ||
+        cached != items || cached[0].argoff != 99) {
+        nfails++;
+        printf("FAIL: expected cache hit\n");
+    }
+    if (options.optind != 7 || options.errmsg[0]) {
+        nfails++;
+        printf("FAIL: expected optind 7 after a hit, got %d\n",
+               options.optind);
+    }
+    storage[items - storage].argoff = 0;
+    if (n != (int)(sizeof(expect) / sizeof(*expect))) {
+        nfails++;
+        printf("FAIL: expected %d results, got %d\n",
+               (int)(sizeof(expect) / sizeof(*expect)), n);
+        n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (memcmp(items + i, expect + i, sizeof(*items))) {
+            nfails++;
+            printf("FAIL (%2d): expected {%d, %d, %d, %d}, "
+                   "got {%d, %d, %d, %d}\n", i,
+                   expect[i].option, expect[i].longindex,
+                   expect[i].argind, expect[i].argoff,
+                   items[i].option, items[i].longindex,
+                   items[i].argind, items[i].argoff);
+        }
     }
-    return nfails != 0;
+    if (strcmp(first[1], "x") || strcmp(first[4], "y")) {
+        nfails++;
+        printf("FAIL: expected argv to be unpermuted\n");
+    }
+
+    /* The same contents from another optind must not share results. */
+    optparse_init(&options, second);
+    optparse_arg(&options);
+    n = optparse_cached(&options, longopts, &cache, &cached);
+    if (n != 5 || cached[2].argind != 3 || cached[2].argoff != 8) {
+        nfails++;
+        printf("FAIL: expected a cache miss for a different optind\n");
+    }
+
+    /* Resuming in the middle of a cluster must not share results. */
+    optparse_init(&options, cluster);
+    optparse_long(&options, longopts, 0);
+    n = optparse_cached(&options, longopts, &cache, &items);
+    optparse_init(&options, cluster);
+    if (n != 1 || optparse_cached(&options, longopts, &cache, &items) != 2 ||
+        items[0].option != 'a' || items[1].option != 'b') {
+        nfails++;
+        printf("FAIL: expected a cache miss for a different subopt\n");
+    }
+
+    optparse_init(&options, dashdash);
+    n = optparse_cached(&options, longopts, &cache, &items);
+    if (n != 2 || items[0].option != 'a' || items[1].longindex != -1 ||
+        items[1].argind != 3) {
+        nfails++;
+        printf("FAIL: expected option and argument around --, got %d\n", n);
+    }
+
+    optparse_init(&options, invalid);
+    n = optparse_cached(&options, longopts, &cache, &items);
+    if (n != -1 || strncmp(options.errmsg, OPTPARSE_MSG_INVALID,
+                           strlen(OPTPARSE_MSG_INVALID))) {
+        nfails++;
+        printf("FAIL: expected invalid option error, got %d\n", n);
+    }
+
+    optparse_init(&options, deep);
+    n = optparse_cached(&options, longopts, &cache, &items);
+    if (n != -1 || strcmp(options.errmsg, OPTPARSE_MSG_DEPTH) ||
+        options.error != OPTPARSE_EDEPTH) {
+        nfails++;
+        printf("FAIL: expected depth error, got %d\n", n);
+    }
+    return nfails;
+}
+
+static int
+lookup_tests(void)
+{
+    char *argv[] = {
+        "", "-v", "plugin", "--log-dir", "--verbose", "-vL/tmp",
+        "--no-trace", "--", "--verbose", 0
+    };
+    char *invalid[] = {"", "-v", "--bogus", 0};
+    struct {
+        char *name;
+        int count;
+        char *optarg;
+    } t[] = {
+        {"verbose",  2,  0},
+        {"log-dir",  2,  "/tmp"},
+        {"logdir",   2,  "/tmp"},
+        {"color",    0,  0},
+        {"bogus",    0,  0},
+        {"trace",    1,  "no-trace"},
+        {"no-trace", 1,  "no-trace"},
+        {"no-color", 0,  0},
+        {"no-",      0,  0},
+    };
+    int ntests = sizeof(t) / sizeof(*t);
+    int i, counts[5], slots[6], nfails = 0;
+    char *values[5], *optarg;
+    struct optparse_index index;
+    struct optparse_long longopts[] = {
+        {"verbose",        'v', OPTPARSE_NONE},
+        {"log-dir|logdir", 'L', OPTPARSE_REQUIRED},
+        {"color",          'c', OPTPARSE_OPTIONAL},
+        {"trace",          't', OPTPARSE_NEGATABLE},
+        {0, 0, 0}
+    };
+
+    if (optparse_index_init(&index, argv, longopts, counts, values,
+                            slots, 5)) {
+        nfails++;
+        printf("FAIL: expected 5 names to need 6 slots\n");
+    }
+    optparse_index_init(&index, argv, longopts, counts, values, slots, 6);
+    for (i = 0; i < ntests; i++) {
+        int count = optparse_lookup(&index, t[i].name, &optarg);
+        if (count != t[i].count) {
+            nfails++;
+            printf("FAIL (%2d): expected %s %d times, got %d\n",
+                   i, t[i].name, t[i].count, count);
+        }
+        if (t[i].optarg ? !optarg || strcmp(optarg, t[i].optarg)
+                        : optarg != 0) {
+            nfails++;
+            printf("FAIL (%2d): expected optarg %s, got %s\n",
+                   i, t[i].optarg ? t[i].optarg : "(nil)",
+                   optarg ? optarg : "(nil)");
+        }
+    }
+    if (strcmp(argv[2], "plugin")) {
+        nfails++;
+        printf("FAIL: expected argv to be unpermuted\n");
+    }
+
+    optparse_index_init(&index, invalid, longopts, counts, values,
+                        slots, 6);
+    if (optparse_lookup(&index, "verbose", 0) != -1) {
+        nfails++;
+        printf("FAIL: expected lookup error\n");
+    }
+    return nfails;
+}
+
+static int
+completion_tests(void)
+{
+    struct {
+        char *word;
+        int matches[4];
+        char *prev;
+        int index;
+    } t[] = {
+        {"--",     {0, 1, 2, 3},  "-a",       -1},
+        {"-",      {0, 1, 2, 3},  "-c",       -1},
+        {"--c",    {2, -1},       "-ad",      3},
+        {"--col",  {2, -1},       "-dc",      -1},
+        {"--x",    {-1},          "--delay",  3},
+        {"-a",     {-1},          "--delay=", -1},
+        {"color",  {-1},          "--color",  -1},
+        {"--dela", {3, -1},       "delay",    -1},
+    };
+    int ntests = sizeof(t) / sizeof(*t);
+    int i, nfails = 0;
+    struct optparse_long longopts[] = {
+        {"amend", 'a', OPTPARSE_NONE},
+        {"brief", 'b', OPTPARSE_NONE},
+        {"color", 'c', OPTPARSE_OPTIONAL},
+        {"delay", 'd', OPTPARSE_REQUIRED},
+        {0, 0, 0}
+    };
+
+    for (i = 0; i < ntests; i++) {
+        int j, index = -1;
+        for (j = 0; j < 4; j++) {
+            index = optparse_complete(longopts, t[i].word, index + 1);
+            if (index != t[i].matches[j]) {
+                nfails++;
+                printf("FAIL (%2d): expected match %d for %s, got %d\n",
+                       i, t[i].matches[j], t[i].word, index);
+            }
+            if (index == -1)
+                break;
+        }
+
+        index = optparse_complete_arg(longopts, t[i].prev);
+        if (index != t[i].index) {
+            nfails++;
+            printf("FAIL (%2d): expected argument of %d after %s, got %d\n",
+                   i, t[i].index, t[i].prev, index);
+        }
+    }
+    return nfails;
 }
 
 int
@@ -297,6 +976,18 @@ main(int argc, char **argv)
     if (argc > 1) {
         return manual_test(argc, argv);
     } else {
-        return testsuite();
+        int nfails = testsuite();
+        nfails += utf8_tests();
+        nfails += check_tests();
+        nfails += negation_tests();
+        nfails += state_tests();
+        nfails += snapshot_tests();
+        nfails += cache_tests();
+        nfails += lookup_tests();
+        nfails += completion_tests();
+        if (nfails == 0) {
+            puts("All tests pass.");
+        }
+        return nfails != 0;
     }
 }